@@ -2,14 +2,28 @@
 #include "mgos_gpio.h"
 #include "mgos_time.h"
 #include "mgos_system.h"
-#define RCSWITCH_MAX_CHANGES 67
+#include "mgos_timers.h"
+// Longest code the receiver decodes, in bits.
+#define RCSWITCH_MAX_BITS 32
+// Captured durations are stored in 16 bits; anything longer is a gap anyway.
+#define RCSWITCH_MAX_DURATION 0xFFFF
 // interrupt handler and related code must be in RAM on ESP8266,
-// according to issue #46.
-#define RECEIVE_ATTR ICACHE_RAM_ATTR
+// according to issue #46. Mongoose OS defines IRAM for every platform that
+// needs it (ESP8266, ESP32) and leaves it empty on the others.
+#ifndef IRAM
+#define IRAM
+#endif
+#define RECEIVE_ATTR IRAM
 #define VAR_ISR_ATTR
+// constant tables go to flash instead of DRAM on ESP8266.
+#ifdef ICACHE_RODATA_ATTR
+#define RODATA_ATTR ICACHE_RODATA_ATTR
+#else
+#define RODATA_ATTR
+#endif
 
 /* Format for protocol definitions:
- * {pulselength, Sync bit, "0" bit, "1" bit, invertedSignal}
+ * (pulselength, Sync bit, "0" bit, "1" bit, invertedSignal, lineCode, preamble)
  *
  * pulselength: pulse length in microseconds, e.g. 350
  * Sync bit: {1, 31} means 1 high pulse and 31 low pulses
@@ -26,50 +40,184 @@
  *     |   |_
  *
  * These are combined to form Tri-State bits when sending or receiving codes.
+ *
+ * lineCode: how a data bit maps to the "0" and "1" waveforms, see
+ *     RCSWITCH_LINE_PULSE_PAIR and RCSWITCH_LINE_BIPHASE.
+ *     Halves of zero length are allowed; adjacent halves of the same level
+ *     then run together into one longer pulse, which is how Manchester is
+ *     described.
+ * preamble: waveform sent ahead of the data bits, e.g. {1, 10}; {0, 0}
+ *     sends none.
+ *
+ * A frame is sent as preamble, data bits, sync and repeated as such, so the
+ * receiver sees the long half of the sync as the gap between frames.
+ *
+ * Each row is ROW(number, (fields)). The receiver sizes its buffers from the
+ * rows, so adding a protocol needs nothing but a new row.
+ *
+ * The table is kept in flash. Flash on the ESP8266 can only be read in whole
+ * 32-bit words, so every entry is padded to a word boundary and copied out
+ * with getProto().
  */
-Protocol_t protocol;
-uint16_t bit_pattern[126];
-
-Protocol_t proto[] = {
-    {350, {1, 31}, {1, 3}, {3, 1}, 0},    // protocol 1
-    {650, {1, 10}, {1, 2}, {2, 1}, 0},    // protocol 2
-    {100, {30, 71}, {4, 11}, {9, 6}, 0},  // protocol 3
-    {380, {1, 6}, {1, 3}, {3, 1}, 0},     // protocol 4
-    {500, {6, 14}, {1, 2}, {2, 1}, 0},    // protocol 5
-    {450, {23, 1}, {1, 2}, {2, 1}, 1},    // protocol 6 (HT6P20B)
-    {150, {2, 62}, {1, 6}, {6, 1}, 0},    // protocol 7 (HS2303-PT, i. e. used in AUKEY Remote)
-    {200, {3, 130}, {7, 16}, {3, 16}, 0}, // protocol 8 Conrad RS-200 RX
-    {200, {130, 7}, {16, 7}, {16, 3}, 1}, // protocol 9 Conrad RS-200 TX
-    {365, {18, 1}, {3, 1}, {1, 3}, 1},    // protocol 10 (1ByOne Doorbell)
-    {270, {36, 1}, {1, 2}, {2, 1}, 1},    // protocol 11 (HT12E)
-    {320, {36, 1}, {1, 2}, {2, 1}, 1}     // protocol 12 (SM5212)
-};
+#define PROTO_TABLE(ROW)                                                                                                          \
+  ROW(1, (350, {1, 31}, {1, 3}, {3, 1}, 0, RCSWITCH_LINE_PULSE_PAIR, {0, 0}))    /* protocol 1 */                                  \
+  ROW(2, (650, {1, 10}, {1, 2}, {2, 1}, 0, RCSWITCH_LINE_PULSE_PAIR, {0, 0}))    /* protocol 2 */                                  \
+  ROW(3, (100, {30, 71}, {4, 11}, {9, 6}, 0, RCSWITCH_LINE_PULSE_PAIR, {0, 0}))  /* protocol 3 */                                  \
+  ROW(4, (380, {1, 6}, {1, 3}, {3, 1}, 0, RCSWITCH_LINE_PULSE_PAIR, {0, 0}))     /* protocol 4 */                                  \
+  ROW(5, (500, {6, 14}, {1, 2}, {2, 1}, 0, RCSWITCH_LINE_PULSE_PAIR, {0, 0}))    /* protocol 5 */                                  \
+  ROW(6, (450, {23, 1}, {1, 2}, {2, 1}, 1, RCSWITCH_LINE_PULSE_PAIR, {0, 0}))    /* protocol 6 (HT6P20B) */                        \
+  ROW(7, (150, {2, 62}, {1, 6}, {6, 1}, 0, RCSWITCH_LINE_PULSE_PAIR, {0, 0}))    /* protocol 7 (HS2303-PT, i. e. used in AUKEY Remote) */ \
+  ROW(8, (200, {3, 130}, {7, 16}, {3, 16}, 0, RCSWITCH_LINE_PULSE_PAIR, {0, 0})) /* protocol 8 Conrad RS-200 RX */                 \
+  ROW(9, (200, {130, 7}, {16, 7}, {16, 3}, 1, RCSWITCH_LINE_PULSE_PAIR, {0, 0})) /* protocol 9 Conrad RS-200 TX */                 \
+  ROW(10, (365, {18, 1}, {3, 1}, {1, 3}, 1, RCSWITCH_LINE_PULSE_PAIR, {0, 0}))   /* protocol 10 (1ByOne Doorbell) */               \
+  ROW(11, (270, {36, 1}, {1, 2}, {2, 1}, 1, RCSWITCH_LINE_PULSE_PAIR, {0, 0}))   /* protocol 11 (HT12E) */                         \
+  ROW(12, (320, {36, 1}, {1, 2}, {2, 1}, 1, RCSWITCH_LINE_PULSE_PAIR, {0, 0}))   /* protocol 12 (SM5212) */                        \
+  ROW(13, (260, {1, 40}, {1, 1}, {1, 5}, 0, RCSWITCH_LINE_BIPHASE, {1, 10}))     /* protocol 13 (HomeEasy/Nexa self-learning) */   \
+  ROW(14, (500, {1, 20}, {1, 0}, {0, 1}, 0, RCSWITCH_LINE_BIPHASE, {0, 0}))      /* protocol 14 (plain Manchester) */
+
+#define PROTO_FIELDS(...) __VA_ARGS__
+#define PROTO_ENTRY(n, fields) {{PROTO_FIELDS fields}},
+
+typedef union ProtoEntry_t
+{
+  Protocol_t p;
+  uint32_t w[(sizeof(Protocol_t) + 3) / 4];
+} ProtoEntry_t;
+
+static const ProtoEntry_t proto[] RODATA_ATTR = {PROTO_TABLE(PROTO_ENTRY)};
 
 enum
 {
   numProto = sizeof(proto) / sizeof(proto[0])
 };
 
-int nRepeat;
+/**
+ * Copies protocol nProtocol (1-based) out of the flash table.
+ */
+static Protocol_t getProto(int nProtocol)
+{
+  const volatile uint32_t *src = proto[nProtocol - 1].w;
+  ProtoEntry_t e;
+  for (unsigned int i = 0; i < sizeof(e.w) / sizeof(e.w[0]); i++)
+  {
+    e.w[i] = src[i];
+  }
+  return e.p;
+}
+
+#if !RCSWITCH_DISABLE_TRANSMITTING
+Protocol_t protocol;
 int nTransmitterPin;
 int nRepeatTransmit;
+static char sCodeWordBuf[13];
+#endif
+
+#if !RCSWITCH_DISABLE_RECEIVING
+#define RX_PROTO_ENABLED(n) ((RCSWITCH_PROTOCOLS >> ((n) - 1)) & 1)
+#define RX_PROTO_ENABLED4(n) \
+  (RX_PROTO_ENABLED(n) + RX_PROTO_ENABLED(n + 1) + RX_PROTO_ENABLED(n + 2) + RX_PROTO_ENABLED(n + 3))
+#define RX_PROTO_COUNT                                                  \
+  (RX_PROTO_ENABLED4(1) + RX_PROTO_ENABLED4(5) + RX_PROTO_ENABLED4(9) + \
+   RX_PROTO_ENABLED4(13) + RX_PROTO_ENABLED4(17) + RX_PROTO_ENABLED4(21) + \
+   RX_PROTO_ENABLED4(25) + RX_PROTO_ENABLED4(29))
+
+#if RX_PROTO_COUNT == 0
+#error "RCSWITCH_PROTOCOLS selects no protocol to receive"
+#endif
+_Static_assert(numProto <= 32 && ((unsigned long)RCSWITCH_PROTOCOLS >> numProto) == 0,
+               "RCSWITCH_PROTOCOLS selects a protocol that is not in the table");
+
+/* Most timings one frame of a protocol takes: the gap, the preamble, the
+ * inverted sync half or the trailing one, and 2 timings per bit for pulse
+ * pairs, 4 for biphase. The line code is the 9th argument once the braces of
+ * a row are split at their commas. The largest over all received protocols
+ * is the size of a union with one member per row. */
+#define PROTO_LINE_CODE(pulse, sh, sl, zh, zl, oh, ol, inv, line, ph, pl) line
+#define PROTO_CHANGES(n, fields) \
+  char p##n[RX_PROTO_ENABLED(n) ? 4 + RCSWITCH_MAX_BITS * (PROTO_LINE_CODE fields == RCSWITCH_LINE_BIPHASE ? 4 : 2) : 1];
+enum
+{
+  RCSWITCH_MAX_CHANGES = sizeof(union { PROTO_TABLE(PROTO_CHANGES) })
+};
+
+// Edges are captured into a ring buffer large enough to hold a whole frame
+// plus whatever came before it, so that a frame can be searched for at any
+// offset. Must be a power of two.
+#ifndef RCSWITCH_WINDOW
+#define RCSWITCH_WINDOW (RCSWITCH_MAX_CHANGES < 128 ? 128 : RCSWITCH_MAX_CHANGES < 256 ? 256 : 512)
+#endif
+_Static_assert(!(RCSWITCH_WINDOW & (RCSWITCH_WINDOW - 1)) && RCSWITCH_WINDOW > RCSWITCH_MAX_CHANGES,
+               "RCSWITCH_WINDOW must be a power of two larger than RCSWITCH_MAX_CHANGES");
+
+// RAM copy of the protocols the receiver decodes, so that the decoder does
+// not have to copy them out of flash word by word for every try.
+static Protocol_t rxProto[RX_PROTO_COUNT];
+static uint8_t rxProtoNumber[RX_PROTO_COUNT];
+
 int nReceiverInterrupt;
-int nReceiveTolerance;
 volatile unsigned long nReceivedValue = 0;
 volatile unsigned int nReceivedBitlength = 0;
 volatile unsigned int nReceivedDelay = 0;
 volatile unsigned int nReceivedProtocol = 0;
 int nReceiveTolerance = 60;
+unsigned int nGlitchLimit = 50;
+unsigned int nNoiseGateEdges = 0;
+unsigned int nNoiseGateWindow = 0;
 const unsigned int nSeparationLimit = 4300;
-unsigned int timings[RCSWITCH_MAX_CHANGES];
+uint16_t timings[RCSWITCH_WINDOW];
+// total number of edges captured; timings[nChangeCount % RCSWITCH_WINDOW]
+// is the next slot to be written
+static volatile unsigned int nChangeCount = 0;
+// value of nChangeCount when the noise gate last opened; timings before it
+// are cut off from the ones after by the time the gate was closed
+static volatile unsigned int nResumeCount = 0;
+// Gaps that may end a frame, queued by the ISR for decodeGaps(), which
+// searches the window for the frame in task context. Must be a power of two.
+#define RCSWITCH_GAP_QUEUE 4
+static struct
+{
+  unsigned int end;
+  unsigned int gap;
+} gapQueue[RCSWITCH_GAP_QUEUE];
+static volatile uint8_t gapHead = 0;
+static volatile uint8_t gapTail = 0;
+static volatile uint8_t decodeScheduled = 0;
+// Noise gate: while it is closed the receiver interrupt is off for
+// gateHold microseconds at a time; gateResumed tells the ISR it is back on.
+static volatile unsigned long gateHold = 0;
+static volatile uint8_t gateClosing = 0;
+static volatile uint8_t gateResumed = 0;
+
+/**
+ * Copies the protocols selected by RCSWITCH_PROTOCOLS to rxProto.
+ */
+static void loadRxProtocols(void)
+{
+  unsigned int n = 0;
+  for (int p = 1; p <= numProto; p++)
+  {
+    if (RX_PROTO_ENABLED(p))
+    {
+      rxProto[n] = getProto(p);
+      rxProtoNumber[n++] = p;
+    }
+  }
+}
+#endif
 
 void RCSwitch_Init(void)
 {
+#if !RCSWITCH_DISABLE_TRANSMITTING
   nTransmitterPin = -1;
   setRepeatTransmit(10);
   setProtocol1(1);
+#endif
+#if !RCSWITCH_DISABLE_RECEIVING
+  loadRxProtocols();
+#endif
 }
 
+#if !RCSWITCH_DISABLE_TRANSMITTING
 /**
  * Sets the protocol to send.
  */
@@ -87,7 +235,7 @@ void setProtocol1(int nProtocol)
   {
     nProtocol = 1; // TODO: trigger an error, e.g. "bad protocol" ???
   }
-  protocol = proto[nProtocol - 1];
+  protocol = getProto(nProtocol);
 }
 
 /**
@@ -229,10 +377,12 @@ void switchOff3(const char *sGroup, const char *sDevice)
 /**
  * Returns a char[13], representing the code word to be send.
  *
+ * All getCodeWord functions share one buffer, so the result is only valid
+ * until the next call to any of them.
  */
 char *getCodeWordA(const char *sGroup, const char *sDevice, bool bStatus)
 {
-  static char sReturn[13];
+  char *sReturn = sCodeWordBuf;
   int nReturnPos = 0;
 
   for (int i = 0; i < 5; i++)
@@ -271,7 +421,7 @@ char *getCodeWordA(const char *sGroup, const char *sDevice, bool bStatus)
  */
 char *getCodeWordB(int nAddressCode, int nChannelCode, bool bStatus)
 {
-  static char sReturn[13];
+  char *sReturn = sCodeWordBuf;
   int nReturnPos = 0;
 
   if (nAddressCode < 1 || nAddressCode > 4 || nChannelCode < 1 || nChannelCode > 4)
@@ -304,7 +454,7 @@ char *getCodeWordB(int nAddressCode, int nChannelCode, bool bStatus)
  */
 char *getCodeWordC(char sFamily, int nGroup, int nDevice, bool bStatus)
 {
-  static char sReturn[13];
+  char *sReturn = sCodeWordBuf;
   int nReturnPos = 0;
 
   int nFamily = (int)sFamily - 'a';
@@ -356,7 +506,7 @@ char *getCodeWordC(char sFamily, int nGroup, int nDevice, bool bStatus)
  */
 char *getCodeWordD(char sGroup, int nDevice, bool bStatus)
 {
-  static char sReturn[13];
+  char *sReturn = sCodeWordBuf;
   int nReturnPos = 0;
 
   // sGroup must be one of the letters in "abcdABCD"
@@ -436,6 +586,44 @@ void send(const char *sCodeWord)
   send1(code, length);
 }
 
+/*
+ * Line writer: accumulates consecutive halves of the same level and only
+ * toggles the pin when the level changes, so zero-length halves (Manchester)
+ * come out as one longer pulse.
+ */
+typedef struct LineWriter
+{
+  uint8_t level;
+  unsigned int units;
+} LineWriter;
+
+static void lineFlush(LineWriter *w)
+{
+  if (w->units == 0)
+    return;
+  mgos_gpio_write(nTransmitterPin, w->level ^ protocol.invertedSignal);
+  mgos_usleep(protocol.pulseLength * w->units);
+  w->units = 0;
+}
+
+static void lineWrite(LineWriter *w, uint8_t level, unsigned int units)
+{
+  if (units == 0)
+    return;
+  if (level != w->level)
+  {
+    lineFlush(w);
+    w->level = level;
+  }
+  w->units += units;
+}
+
+static void lineWritePulse(LineWriter *w, HighLow pulses)
+{
+  lineWrite(w, 1, pulses.high);
+  lineWrite(w, 0, pulses.low);
+}
+
 /**
  * Transmit the first 'length' bits of the integer 'code'. The
  * bits are sent from MSB to LSB, i.e., first the bit at position length-1,
@@ -447,16 +635,21 @@ void send1(unsigned long code, unsigned int length)
   if (nTransmitterPin == -1)
     return;
 
+  const HighLow symbol[2] = {protocol.zero, protocol.one};
+  const uint8_t biphase = (protocol.lineCode == RCSWITCH_LINE_BIPHASE);
+  LineWriter w = {0, 0};
   
   for (int nRepeat = 0; nRepeat < nRepeatTransmit; nRepeat++) {
+    lineWritePulse(&w, protocol.preamble);
     for (int i = length-1; i >= 0; i--) {
-      if (code & (1L << i))
-        transmit_data(protocol.one);
-      else
-        transmit_data(protocol.zero);
+      const uint8_t bit = (code >> i) & 1;
+      lineWritePulse(&w, symbol[bit]);
+      if (biphase)
+        lineWritePulse(&w, symbol[!bit]);
     }
-    transmit_data(protocol.syncFactor);
+    lineWritePulse(&w, protocol.syncFactor);
   }
+  lineFlush(&w);
   // Disable transmit after sending (i.e., for inverted protocols)
   mgos_gpio_write(nTransmitterPin, 0);
 }
@@ -465,18 +658,14 @@ void send1(unsigned long code, unsigned int length)
  */
 void transmit_data(HighLow pulses)
 {
- 
-  uint8_t firstLogicLevel = (protocol.invertedSignal) ? 0 : 1;
-  uint8_t secondLogicLevel = (protocol.invertedSignal) ? 1 : 0;
+  LineWriter w = {!pulses.high, 0};
 
-  mgos_gpio_write(nTransmitterPin, firstLogicLevel);
-  mgos_usleep(protocol.pulseLength * pulses.high);
-  
-  mgos_gpio_write(nTransmitterPin, secondLogicLevel);
-  mgos_usleep(protocol.pulseLength * pulses.low);
-  
+  lineWritePulse(&w, pulses);
+  lineFlush(&w);
 }
+#endif
 
+#if !RCSWITCH_DISABLE_RECEIVING
 /**
  * Set Receiving Tolerance
  */
@@ -486,11 +675,38 @@ void setReceiveTolerance(int nPercent)
   nReceiveTolerance = nPercent;
 }
 
+/**
+ * Set the glitch filter: level changes that last less than nMicros
+ * microseconds are merged into the surrounding pulse. 0 disables the filter.
+ */
+void setGlitchFilter(unsigned int nMicros)
+{
+  nGlitchLimit = nMicros;
+}
+
+/**
+ * Set the noise gate: while more than nMaxEdges edges arrive within
+ * nWindowMicros microseconds, the signal is taken to be noise and nothing is
+ * captured or decoded. Meanwhile the receiver interrupt is turned off, for
+ * one window at first and for up to 8 while the noise lasts.
+ * nMaxEdges = 0 disables the gate.
+ *
+ * @param nMaxEdges     most edges a real frame produces in one window
+ * @param nWindowMicros length of the measuring window in microseconds
+ */
+void setNoiseGate(unsigned int nMaxEdges, unsigned int nWindowMicros)
+{
+  nNoiseGateEdges = nMaxEdges;
+  nNoiseGateWindow = nWindowMicros;
+}
+
 /**
  * Enable receiving data
  */
 void enableReceive(int interrupt)
 {
+  loadRxProtocols();
+
   nReceiverInterrupt = interrupt;
   mgos_gpio_set_mode(nReceiverInterrupt, MGOS_GPIO_MODE_INPUT);
 
@@ -550,26 +766,143 @@ unsigned int getReceivedProtocol()
   return timings;
 }*/
 
-/* helper function for the receiveProtocol method */
-static inline unsigned int diff(long A, long B)
+static inline unsigned int timingAt(unsigned int pos)
 {
-  return abs(A - B);
+  return timings[pos & (RCSWITCH_WINDOW - 1)];
 }
 
-/**
- *
+/*
+ * Line reader: walks the captured timings with the same half-by-half view
+ * the line writer uses to send them. A half either uses up the current
+ * timing (within tolerance) or just a leading part of it, in which case the
+ * next half must have the same level. With lead set, the first half has the
+ * level of the gap ahead of the frame and ran together with it, as with a
+ * Manchester frame starting with a 1; it is taken out of the gap.
  */
-int receiveProtocol(const int p, unsigned int changeCount2)
+typedef struct LineReader
 {
-  
-  unsigned int ip;
-  const Protocol_t pro = proto[p - 1];
+  const Protocol_t *pro;
+  unsigned int start;    // ring position of the frame's first timing
+  unsigned int ip;       // current timing, relative to start
+  long rem;              // part of the current timing not matched yet
+  unsigned int count;    // number of timings in the frame
+  unsigned long delay;
+  long tolerance;
+  uint8_t lead;          // the first half is still to be taken out of the gap
+} LineReader;
+
+static inline int lineRead(LineReader *r, uint8_t level, unsigned int units)
+{
+  if (units == 0)
+    return 1;
+  // timings alternate in level; for non-inverted protocols timings[1] is high
+  if (r->lead)
+  {
+    r->lead = 0;
+    return ((r->ip & 1) ^ r->pro->invertedSignal) != level;
+  }
+  if (r->ip >= r->count || ((r->ip & 1) ^ r->pro->invertedSignal) != level)
+    return 0;
+  r->rem -= r->delay * units;
+  if (r->rem <= -r->tolerance)
+    return 0;
+  if (r->rem < r->tolerance)
+  {
+    r->ip++;
+    r->rem = (r->ip < r->count) ? timingAt(r->start + r->ip) : 0;
+  }
+  return 1;
+}
+
+static inline int lineReadPulse(LineReader *r, HighLow pulses)
+{
+  return lineRead(r, 1, pulses.high) && lineRead(r, 0, pulses.low);
+}
+
+/*
+ * A decoded frame, as reported through getReceivedValue() and friends.
+ */
+typedef struct Frame
+{
+  unsigned long code;
+  unsigned int bitlength;
+  unsigned int delay;
+  unsigned int protocol;
+} Frame;
+
+static inline void publishFrame(const Frame *f)
+{
+  nReceivedValue = f->code;
+  nReceivedBitlength = f->bitlength;
+  nReceivedDelay = f->delay;
+  nReceivedProtocol = f->protocol;
+}
+
+/*
+ * Reads the data bits of a frame and the half of the sync that ends it;
+ * r->count must be the position of the gap after the frame.
+ */
+static int readFrame(LineReader *r, Frame *f)
+{
+  const Protocol_t *pro = r->pro;
+  const HighLow symbol[2] = {pro->zero, pro->one};
+  const uint8_t biphase = (pro->lineCode == RCSWITCH_LINE_BIPHASE);
+  const unsigned int trailer = (pro->invertedSignal) ? 0 : pro->syncFactor.high;
+  unsigned int nBits = 0;
   unsigned long code = 0;
-  // Assuming the longer pulse length is the pulse captured in timings[0]
-  const unsigned int syncLengthInPulses = ((pro.syncFactor.low) > (pro.syncFactor.high)) ? (pro.syncFactor.low) : (pro.syncFactor.high);
-  const unsigned long delay = timings[0] / syncLengthInPulses;
-  // const unsigned long delay = timings[0];
+  LineReader t;
+
+  if (pro->invertedSignal && !lineRead(r, 0, pro->syncFactor.low))
+    return 0;
+  if (!lineReadPulse(r, pro->preamble))
+    return 0;
+
+  for (;;)
+  {
+    t = *r;
+    if (lineRead(&t, 1, trailer) && t.ip == r->count)
+      break;
+    if (nBits == RCSWITCH_MAX_BITS)
+      return 0;
+
+    uint8_t bit = 0;
+    t = *r;
+    if (!lineReadPulse(&t, symbol[0]) || (biphase && !lineReadPulse(&t, symbol[1])))
+    {
+      bit = 1;
+      t = *r;
+      if (!lineReadPulse(&t, symbol[1]) || (biphase && !lineReadPulse(&t, symbol[0])))
+      {
+        //  Failed
+        return 0;
+      }
+    }
+    code = (code << 1) | bit;
+    nBits++;
+    *r = t;
+  }
+  f->code = code;
+  f->bitlength = nBits;
+  return 1;
+}
+
+/*
+ * Decodes the changeCount2 timings starting at ring position start into f.
+ * The first of them is the gap ahead of the frame; syncGap is the gap the
+ * frame is measured against, normally the one that ends it.
+ */
+static int decodeProtocol(const Protocol_t *pro, const int p, unsigned int start, unsigned int changeCount2, unsigned int syncGap, Frame *f)
+{
+  // Assuming the longer pulse length is the gap
+  const unsigned int syncLengthInPulses = ((pro->syncFactor.low) > (pro->syncFactor.high)) ? (pro->syncFactor.low) : (pro->syncFactor.high);
+  if (syncLengthInPulses == 0)
+    return 0; // rxProto not loaded yet
+  const unsigned long delay = syncGap / syncLengthInPulses;
   const unsigned long delayTolerance = delay * nReceiveTolerance / 100;
+  // a frame that may start low runs together with the gap ahead of it when
+  // it does, so it is read both ways
+  const uint8_t lowStart = !pro->invertedSignal && pro->preamble.high == 0 &&
+                           (pro->preamble.low != 0 || pro->zero.high == 0 || pro->one.high == 0);
  
   /* For protocols that start low, the sync period looks like
    *               _________
@@ -587,82 +920,243 @@ int receiveProtocol(const int p, unsigned int changeCount2)
    * |-filtered out-|--1st dur--|--Start data--|
    *
    * The 2nd saved duration starts the data
+   *
+   * Non-inverted frames end with the high half of the next sync; inverted
+   * ones end right at the gap.
    */
 
-  unsigned int firstDataTiming = (pro.invertedSignal) ? 2 : 1;
-  
-  for (ip = firstDataTiming; ip < changeCount2 - 1; ip = ip + 2)
+  if (changeCount2 <= 7)
+    return 0; // ignore very short transmissions: no device sends them, so this must be noise
+  for (uint8_t lead = 0; lead <= lowStart; lead++)
   {
-
-    code <<= 1;
-    
-    if (diff(timings[ip], delay * pro.zero.high) < delayTolerance && diff(timings[ip + 1], delay * pro.zero.low) < delayTolerance)
+    LineReader r = {pro, start, 1, timingAt(start + 1), changeCount2, delay, delayTolerance, lead};
+    if (readFrame(&r, f))
     {
-      // zero
+      f->delay = delay;
+      f->protocol = p;
+      return 1;
     }
-    else if (diff(timings[ip], delay * pro.one.high) < delayTolerance && diff(timings[ip + 1], delay * pro.one.low) < delayTolerance)
+  }
+  return 0;
+}
+
+/**
+ * Decodes the last changeCount2 captured timings as protocol p, the first
+ * of them being the gap ahead of the frame. Fails for protocols that are
+ * not part of RCSWITCH_PROTOCOLS.
+ */
+int receiveProtocol(const int p, unsigned int changeCount2)
+{
+  const unsigned int start = nChangeCount - changeCount2;
+  Frame f;
+
+  for (unsigned int i = 0; i < RX_PROTO_COUNT; i++)
+  {
+    if (rxProtoNumber[i] == p)
     {
-      // one
-      code |= 1;
-      
+      if (!decodeProtocol(&rxProto[i], p, start, changeCount2, timingAt(start), &f))
+        return 0;
+      publishFrame(&f);
+      return 1;
     }
-    else
-    {
-      //  Failed
-      return 0;
+  }
+  return 0;
+}
+
+/*
+ * Searches the window for a frame that ends at ring position end, just
+ * before a gap of the given length. Any stretch longer than
+ * nSeparationLimit, or at least two thirds as long as the gap, may be the
+ * gap ahead of that frame; candidates are tried from the latest back, so
+ * noise, overflow or another remote's frame ahead of it do not matter.
+ * The search stops where the noise gate last opened, as the timings before
+ * that do not join up with the ones after it.
+ * The frame is measured against the gap that ends it, and reported only
+ * when the frame right before it decoded to the same code.
+ * Runs in task context, while the ISR keeps filling the window; timings the
+ * ISR may have overwritten in the meantime are not used.
+ */
+static void findFrame(unsigned int end, unsigned int gap)
+{
+  static Frame last;
+  static unsigned int lastEnd;
+  const unsigned int resume = nResumeCount;
+  const unsigned int behind = nChangeCount - end;
+  unsigned int limit = end - resume;
+  Frame f;
+
+  if (behind >= RCSWITCH_WINDOW - 1)
+    return;
+  if (limit > RCSWITCH_WINDOW - 1 - behind)
+    limit = RCSWITCH_WINDOW - 1 - behind;
+  if (limit > RCSWITCH_MAX_CHANGES)
+    limit = RCSWITCH_MAX_CHANGES;
+  for (unsigned int n = 1; n <= limit; n++) {
+    const unsigned int t = timingAt(end - n);
+    if (t <= nSeparationLimit && 3 * t < 2 * gap)
+      continue;
+    for (unsigned int i = 0; i < RX_PROTO_COUNT; i++) {
+      if (decodeProtocol(&rxProto[i], rxProtoNumber[i], end - n, n, gap, &f)) {
+        if (nChangeCount - (end - n) >= RCSWITCH_WINDOW)
+          return; // the frame was overwritten while being decoded
+        // receive succeeded for protocol i; confirm it against the frame
+        // before, which must have ended no more than a frame earlier and
+        // after the noise gate last opened
+        if (end - n - lastEnd <= RCSWITCH_MAX_CHANGES && lastEnd - resume <= end - resume &&
+            f.code == last.code &&
+            f.bitlength == last.bitlength && f.protocol == last.protocol) {
+          publishFrame(&f);
+        }
+        last = f;
+        lastEnd = end;
+        return;
+      }
     }
   }
-  if (changeCount2 > 7)
-  { // ignore very short transmissions: no device sends them, so this must be noise
-    nReceivedValue = code;
-    nReceivedBitlength = (changeCount2 - 1) / 2;
-    nReceivedDelay = delay;
-    nReceivedProtocol = p;
-    return 1;
+}
+
+/*
+ * Searches for the frames ending at the gaps the ISR queued. Scheduled by
+ * the ISR through mgos_invoke_cb(), so decoding stays out of interrupt
+ * context and out of IRAM.
+ */
+static void decodeGaps(void *arg)
+{
+  decodeScheduled = 0;
+  while (gapTail != gapHead)
+  {
+    const unsigned int end = gapQueue[gapTail & (RCSWITCH_GAP_QUEUE - 1)].end;
+    const unsigned int gap = gapQueue[gapTail & (RCSWITCH_GAP_QUEUE - 1)].gap;
+    gapTail++;
+    findFrame(end, gap);
   }
-  return 0;
+  (void)arg;
 }
 
-void handleInterrupt_cb(int pin, void *arg)
+/*
+ * Noise gate: turns the receiver interrupt back on. Runs from the timer set
+ * by closeGate().
+ */
+static void openGate(void *arg)
+{
+  gateClosing = 0;
+  gateResumed = 1;
+  if (nReceiverInterrupt != -1)
+    mgos_gpio_enable_int(nReceiverInterrupt);
+  (void)arg;
+}
+
+/*
+ * Noise gate: turns the receiver interrupt off for gateHold microseconds,
+ * so that noise costs no interrupts at all meanwhile. Posted by the ISR.
+ */
+static void closeGate(void *arg)
+{
+  if (nReceiverInterrupt != -1)
+  {
+    mgos_gpio_disable_int(nReceiverInterrupt);
+    if (mgos_set_timer((gateHold + 999) / 1000, 0, openGate, NULL) == 0)
+      openGate(NULL);
+  }
+  else
+  {
+    gateClosing = 0;
+  }
+  (void)arg;
+}
+
+void RECEIVE_ATTR handleInterrupt_cb(int pin, void *arg)
 {
-  static unsigned int changeCount = 0;
   static unsigned long lastTime = 0;
-  static unsigned int repeatCount = 0;
+  // the timing that ended at lastTime; it is captured only at the next
+  // edge, once that shows the edge ending it was not the start of a spike
+  static unsigned long pending = 0;
+  static uint8_t havePending = 0;
+  static unsigned long gateStart = 0;
+  static unsigned int gateEdges = 0;
+  static uint8_t gateClosed = 0;
+  static uint8_t gateBackoff = 0;
+  const unsigned int changeCount = nChangeCount;
 
   const long time = mgos_uptime_micros();
-  const unsigned int duration = time - lastTime;
-
-  if (duration > nSeparationLimit) {
-    // A long stretch without signal level change occurred. This could
-    // be the gap between two transmission.
-    if ((repeatCount==0) || (diff(duration,timings[0]) < 200)) {
-      // This long signal is close in length to the long signal which
-      // started the previously recorded timings; this suggests that
-      // it may indeed by a a gap between two transmissions (we assume
-      // here that a sender will send the signal multiple times,
-      // with roughly the same gap between them).
-      repeatCount++;
-      if (repeatCount == 2) {
-        for(unsigned int i = 1; i <= numProto; i++) {
-          if (receiveProtocol(i, changeCount)) {
-            // receive succeeded for protocol i
-            break;
-          }
-        }
-        repeatCount = 0;
+  const unsigned long elapsed = time - lastTime;
+
+  if (elapsed < nGlitchLimit && havePending) {
+    // A spike too short for any protocol: the pending pulse, the spike and
+    // the next pulse are one pulse, which is timed from the start of the
+    // pending one.
+    lastTime -= pending;
+    havePending = 0;
+    return;
+  }
+
+  if (nNoiseGateEdges != 0) {
+    // Superregenerative receivers output a constant stream of edges when
+    // nothing is sent. The gate is set for a whole window at a time from
+    // the rate of edges that passed the glitch filter in the previous one.
+    // Once it closes, nothing is captured and closeGate() turns the
+    // interrupt off for a window, twice as long each time the noise is
+    // still there when it comes back on, up to 8 windows. The time since
+    // the last edge seen is unknown then, so capture starts afresh.
+    if (gateResumed) {
+      gateResumed = 0;
+      gateClosed = 0;
+      gateEdges = 0;
+      gateStart = time;
+      nResumeCount = changeCount;
+      lastTime = time;
+      havePending = 0;
+      return;
+    }
+    gateEdges++;
+    if ((unsigned long)(time - gateStart) >= nNoiseGateWindow) {
+      if (gateClosed && gateEdges <= nNoiseGateEdges)
+        nResumeCount = changeCount;
+      gateClosed = (gateEdges > nNoiseGateEdges);
+      gateEdges = 0;
+      gateStart = time;
+      if (!gateClosed) {
+        gateBackoff = 0;
+      } else if (!gateClosing) {
+        gateHold = (unsigned long)nNoiseGateWindow << gateBackoff;
+        if (gateBackoff < 3)
+          gateBackoff++;
+        gateClosing = 1;
+        if (!mgos_invoke_cb(closeGate, NULL, true))
+          gateClosing = 0;
       }
     }
-    changeCount = 0;
-  }
- 
-  // detect overflow
-  if (changeCount >= RCSWITCH_MAX_CHANGES) {
-    changeCount = 0;
-    repeatCount = 0;
+    if (gateClosed)
+      havePending = 0;
   }
 
-  timings[changeCount++] = duration;
-  lastTime = time; 
+  if (havePending) {
+    unsigned int duration = pending;
+    if (pending > RCSWITCH_MAX_DURATION)
+    {
+      duration = RCSWITCH_MAX_DURATION;
+    }
+
+    if (duration > nSeparationLimit && (uint8_t)(gapHead - gapTail) < RCSWITCH_GAP_QUEUE) {
+      // A long stretch without signal level change occurred. This could
+      // be the gap after a transmission; have the task search for it.
+      gapQueue[gapHead & (RCSWITCH_GAP_QUEUE - 1)].end = changeCount;
+      gapQueue[gapHead & (RCSWITCH_GAP_QUEUE - 1)].gap = duration;
+      gapHead++;
+      if (!decodeScheduled) {
+        decodeScheduled = 1;
+        if (!mgos_invoke_cb(decodeGaps, NULL, true))
+          decodeScheduled = 0;
+      }
+    }
+
+    timings[changeCount & (RCSWITCH_WINDOW - 1)] = duration;
+    nChangeCount = changeCount + 1;
+  }
+  lastTime = time;
+  pending = elapsed;
+  havePending = 1;
   (void)arg;
   (void)pin;
 }
+#endif
@@ -5,11 +5,38 @@
 // At least for the ATTiny X4/X5, receiving has to be disabled due to
 // missing libm depencies (udivmodhi4)
 
+// Build-time profiles, set as cdefs in the app's mos.yml, e.g.
+//
+//   cdefs:
+//     RCSWITCH_DISABLE_RECEIVING: 1
+//     RCSWITCH_PROTOCOLS: 0x003
+//
+// RCSWITCH_DISABLE_RECEIVING     leave out the receiver (ISR, capture buffer
+//                                and decoder)
+// RCSWITCH_DISABLE_TRANSMITTING  leave out the transmitter and the code word
+//                                helpers
+// RCSWITCH_PROTOCOLS             bit mask of the protocols the receiver
+//                                decodes, bit 0 = protocol 1 (default:
+//                                protocols 1-12; add 0x1000 for protocol 13
+//                                and 0x2000 for protocol 14)
+//
+// tools/footprint.sh reports the RAM/flash use of each profile.
+#ifndef RCSWITCH_DISABLE_RECEIVING
+#define RCSWITCH_DISABLE_RECEIVING 0
+#endif
+#ifndef RCSWITCH_DISABLE_TRANSMITTING
+#define RCSWITCH_DISABLE_TRANSMITTING 0
+#endif
+#ifndef RCSWITCH_PROTOCOLS
+#define RCSWITCH_PROTOCOLS 0xFFF
+#endif
+
 
 // Number of maximum high/Low changes per packet.
 // We can handle up to (unsigned long) => 32 bit * 2 H/L changes per bit + 2 for sync
 
 
+#if !RCSWITCH_DISABLE_TRANSMITTING
 void switchOn2(int nGroupNumber, int nSwitchNumber);
 void switchOff2(int nGroupNumber, int nSwitchNumber);
 void switchOn1(char sFamily, int nGroup, int nDevice);
@@ -22,8 +49,9 @@ void switchOff(char sGroup, int nDevice);
 void sendTriState(const char* sCodeWord);
 void send1(unsigned long code, unsigned int length);
 void send(const char* sCodeWord);
+#endif
     
-
+#if !RCSWITCH_DISABLE_RECEIVING
 void enableReceive(int interrupt);
 void enableReceive1();
 void disableReceive();
@@ -35,12 +63,17 @@ unsigned int getReceivedBitlength();
 unsigned int getReceivedDelay();
 unsigned int getReceivedProtocol();
 unsigned int* getReceivedRawdata();
+void setReceiveTolerance(int nPercent);
+void setGlitchFilter(unsigned int nMicros);
+void setNoiseGate(unsigned int nMaxEdges, unsigned int nWindowMicros);
+#endif
 
+#if !RCSWITCH_DISABLE_TRANSMITTING
 void enableTransmit(int nTransmitterPin);
 void disableTransmit();
 void setPulseLength(int nPulseLength);
 void setRepeatTransmit(int nRepeat);
-void setReceiveTolerance(int nPercent);
+#endif
 
 
 /**
@@ -54,9 +87,26 @@ uint8_t high;
 uint8_t low;
 } HighLow;
 
+/**
+* Line codes, i.e. how a data bit is built from the "zero" and "one" pulses
+* of a protocol.
+*/
+enum {
+/** a bit is sent as its own pulse: 0 -> zero, 1 -> one */
+RCSWITCH_LINE_PULSE_PAIR = 0,
+/**
+* a bit is sent as its own pulse followed by the other one:
+* 0 -> zero one, 1 -> one zero. With zero = {1, 0} and one = {0, 1} this
+* is Manchester coding (protocol 14); with zero = {1, 1} and one = {1, 5}
+* it is the HomeEasy/Nexa self-learning code (protocol 13).
+*/
+RCSWITCH_LINE_BIPHASE = 1
+};
+
 /**
 * A "protocol" describes how zero and one bits are encoded into high/low
-* pulses.
+* pulses, and how a frame is put together:
+* preamble, data bits (as per lineCode), sync.
 */
 typedef struct Protocol_t {
 /** base pulse length in microseconds, e.g. 350 */
@@ -65,8 +115,13 @@ HighLow syncFactor;
 HighLow zero;
 HighLow one;
 uint8_t invertedSignal;
+/** RCSWITCH_LINE_PULSE_PAIR or RCSWITCH_LINE_BIPHASE */
+uint8_t lineCode;
+/** sent ahead of the data bits, {0, 0} for none */
+HighLow preamble;
 } Protocol_t;
 
+#if !RCSWITCH_DISABLE_TRANSMITTING
 void setProtocol(Protocol_t protocol);
 void setProtocol1(int nProtocol);
 void setProtocol2(int nProtocol, int nPulseLength);
@@ -75,14 +130,17 @@ char* getCodeWordB(int nAddressCode, int nChannelCode, bool bStatus);
 char* getCodeWordC(char sFamily, int nGroup, int nDevice, bool bStatus);
 char* getCodeWordD(char sGroup, int nDevice, bool bStatus);
 void transmit_data(HighLow pulses);
+#endif
 
+#if !RCSWITCH_DISABLE_RECEIVING
 void handleInterrupt_cb();
 int receiveProtocol(const int p, unsigned int changeCount);
-volatile unsigned long nReceivedValue;
-volatile unsigned int nReceivedBitlength;
-volatile unsigned int nReceivedDelay;
-volatile unsigned int nReceivedProtocol;
-const unsigned int nSeparationLimit;
+extern volatile unsigned long nReceivedValue;
+extern volatile unsigned int nReceivedBitlength;
+extern volatile unsigned int nReceivedDelay;
+extern volatile unsigned int nReceivedProtocol;
+extern const unsigned int nSeparationLimit;
+#endif
 
 
 
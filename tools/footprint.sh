@@ -0,0 +1,45 @@
+#!/bin/sh
+# Reports the RAM/flash footprint of RCSwitch.c for each build profile.
+#
+# Usage (from the library root):
+#
+#   CC=xtensa-lx106-elf-gcc SIZE=xtensa-lx106-elf-size \
+#   CFLAGS="-I<mongoose-os>/include -I<sdk>/include" tools/footprint.sh
+#
+# CFLAGS must point at the Mongoose OS headers of the target platform. For a
+# rough host-side comparison of profiles, CFLAGS=-Itools/rfsim/include will do;
+# its mgos.h puts IRAM code in a section of its own, so iram is measured too.
+# Columns are bytes: iram is code the ISR path forces into RAM on ESP8266,
+# flash is code plus constant tables in flash, data/bss is static RAM.
+
+CC=${CC:-cc}
+SIZE=${SIZE:-size}
+CFLAGS=${CFLAGS:-}
+SRC=$(dirname "$0")/../RCSwitch.c
+OBJ=${TMPDIR:-/tmp}/rcswitch_footprint.$$.o
+
+trap 'rm -f "$OBJ"' EXIT
+
+printf '%-16s %8s %8s %8s %8s\n' profile iram flash data bss
+
+report()
+{
+  name=$1
+  shift
+  # shellcheck disable=SC2086
+  if ! $CC -Os -fno-common -c $CFLAGS "$@" "$SRC" -o "$OBJ"; then
+    printf '%-16s build failed\n' "$name"
+    return
+  fi
+  $SIZE -A "$OBJ" | awk -v name="$name" '
+    $1 ~ /iram/                       { iram += $2; next }
+    $1 ~ /^\.(text|irom|rodata)/      { flash += $2; next }
+    $1 ~ /^\.data/                    { data += $2; next }
+    $1 ~ /^\.bss/                     { bss += $2; next }
+    END { printf "%-16s %8d %8d %8d %8d\n", name, iram, flash, data, bss }'
+}
+
+report full
+report tx-only -DRCSWITCH_DISABLE_RECEIVING=1
+report rx-only -DRCSWITCH_DISABLE_TRANSMITTING=1
+report rx-protocol-1 -DRCSWITCH_DISABLE_TRANSMITTING=1 -DRCSWITCH_PROTOCOLS=0x001
@@ -0,0 +1,14 @@
+/*
+ * Host stand-ins for the Mongoose OS headers RCSwitch.c uses, so that the
+ * library can be built into tools/rfsim. The functions are implemented by
+ * the simulator on a virtual clock.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Mongoose OS puts IRAM code in RAM on ESP8266/ESP32; here it goes to a
+ * section of its own so that tools/footprint.sh can measure it. */
+#define IRAM __attribute__((section(".iram1.text")))
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+
+enum mgos_gpio_mode
+{
+  MGOS_GPIO_MODE_INPUT = 0,
+  MGOS_GPIO_MODE_OUTPUT = 1
+};
+
+enum mgos_gpio_int_mode
+{
+  MGOS_GPIO_INT_NONE = 0,
+  MGOS_GPIO_INT_EDGE_POS = 1,
+  MGOS_GPIO_INT_EDGE_NEG = 2,
+  MGOS_GPIO_INT_EDGE_ANY = 3
+};
+
+typedef void (*mgos_gpio_int_handler_f)(int pin, void *arg);
+
+bool mgos_gpio_set_mode(int pin, enum mgos_gpio_mode mode);
+void mgos_gpio_write(int pin, bool level);
+bool mgos_gpio_set_int_handler_isr(int pin, enum mgos_gpio_int_mode mode,
+                                   mgos_gpio_int_handler_f cb, void *arg);
+bool mgos_gpio_enable_int(int pin);
+bool mgos_gpio_disable_int(int pin);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef void (*mgos_cb_t)(void *arg);
+
+void mgos_usleep(uint32_t usecs);
+bool mgos_invoke_cb(mgos_cb_t cb, void *arg, bool from_isr);
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdint.h>
+
+int64_t mgos_uptime_micros(void);
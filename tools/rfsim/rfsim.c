@@ -0,0 +1,672 @@
+/*
+ * rfsim: many virtual transmitters sharing one 433 MHz band, received by one
+ * or more virtual receivers running the library's own ISR.
+ *
+ * Every transmitter is driven through send1() with its own protocol, code,
+ * pulse length skew and burst schedule; the GPIO writes are recorded as
+ * carrier on/off intervals on a virtual clock. For every receiver the
+ * intervals of all transmitters are OR-ed together (collisions), pulses are
+ * dropped per link to mimic attenuation, idle noise fills the stretches
+ * without carrier once the receiver's gain has come up, noise spikes flip
+ * the level wherever they land, and the resulting edges are fed to
+ * handleInterrupt_cb(). The callbacks the ISR
+ * posts with mgos_invoke_cb() run a task latency later, as the Mongoose OS
+ * main task would run them, and edges arriving while the receiver interrupt
+ * is off are not seen. Decoded codes are
+ * matched back to the bursts that sent them; a code decoded as the wrong
+ * protocol is counted on its own and not as a decode.
+ *
+ * Build and run from the library root:
+ *
+ *   cc -O2 -I. -Itools/rfsim/include -o rfsim tools/rfsim/rfsim.c RCSwitch.c
+ *   ./rfsim -n 64 -r 2
+ *
+ * Only protocols selected by RCSWITCH_PROTOCOLS can be simulated; add
+ * -DRCSWITCH_PROTOCOLS=0x3FFF to the build for protocols 13 and 14.
+ *
+ * Each receiver runs in a forked child, so that the static state of the ISR
+ * starts out fresh.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "RCSwitch.h"
+#include "mgos_gpio.h"
+#include "mgos_system.h"
+#include "mgos_time.h"
+#include "mgos_timers.h"
+
+#define MAX_PROTOCOLS 16
+
+/* the protocol send1() uses, defined in RCSwitch.c */
+extern Protocol_t protocol;
+
+typedef struct Interval
+{
+  int64_t on;
+  int64_t off;
+  int tx;
+} Interval;
+
+typedef struct Burst
+{
+  int tx;
+  int64_t start;
+  int64_t end;
+} Burst;
+
+typedef struct Transmitter
+{
+  int protocol;
+  unsigned long code;
+  unsigned int length;
+} Transmitter;
+
+/* what one receiver reports back to the parent, followed by the latency
+ * of each decode in milliseconds */
+typedef struct RxStats
+{
+  unsigned int decoded;
+  unsigned int wrongProtocol;
+  unsigned int falseCodes;
+  unsigned int isrCalls;
+  unsigned int taskCalls;
+} RxStats;
+
+static struct
+{
+  int maxDevices;
+  int receivers;
+  double seconds;
+  double intervalMs;
+  int repeats;
+  double skew;
+  double maxDrop;
+  double spikesPerSecond;
+  unsigned int spikeMin;
+  unsigned int spikeMax;
+  unsigned int idleNoise;
+  unsigned int agcDelay;
+  unsigned int glitch;
+  unsigned int gateEdges;
+  unsigned int gateWindow;
+  unsigned int taskLatency;
+  int protocols[MAX_PROTOCOLS];
+  int numProtocols;
+  unsigned int seed;
+} cfg = {64, 1, 60, 5000, 10, 0.05, 0.2, 200, 5, 39, 0, 20000, 50, 0, 0, 1000, {1, 2, 5, 6, 11}, 5, 1};
+
+/* virtual clock and the recorder behind the GPIO stand-ins */
+static int64_t now;
+static int txLevel;
+static int64_t txOn;
+static int txCurrent;
+static bool rxEnabled;
+static Interval *intervals;
+static size_t numIntervals, capIntervals;
+
+/* callbacks posted with mgos_invoke_cb() or mgos_set_timer(), in the order
+ * they are due */
+#define MAX_CALLBACKS 16
+typedef struct Callback
+{
+  mgos_cb_t cb;
+  void *arg;
+  int64_t due;
+} Callback;
+static Callback callbacks[MAX_CALLBACKS];
+static int numCallbacks;
+
+/* level changes one receiver sees */
+static int64_t *edges;
+static size_t numEdges, capEdges;
+
+static void *grow(void *p, size_t *cap, size_t n, size_t size)
+{
+  if (n < *cap)
+    return p;
+  *cap = *cap ? *cap * 2 : 1024;
+  p = realloc(p, *cap * size);
+  if (p == NULL)
+  {
+    perror("realloc");
+    exit(1);
+  }
+  return p;
+}
+
+bool mgos_gpio_set_mode(int pin, enum mgos_gpio_mode mode)
+{
+  (void)pin;
+  (void)mode;
+  return true;
+}
+
+void mgos_gpio_write(int pin, bool level)
+{
+  (void)pin;
+  if (level == txLevel)
+    return;
+  txLevel = level;
+  if (level)
+  {
+    txOn = now;
+    return;
+  }
+  intervals = grow(intervals, &capIntervals, numIntervals, sizeof(*intervals));
+  intervals[numIntervals++] = (Interval){txOn, now, txCurrent};
+}
+
+bool mgos_gpio_set_int_handler_isr(int pin, enum mgos_gpio_int_mode mode,
+                                   mgos_gpio_int_handler_f cb, void *arg)
+{
+  (void)pin;
+  (void)mode;
+  (void)cb;
+  (void)arg;
+  return true;
+}
+
+bool mgos_gpio_enable_int(int pin)
+{
+  (void)pin;
+  rxEnabled = true;
+  return true;
+}
+
+bool mgos_gpio_disable_int(int pin)
+{
+  (void)pin;
+  rxEnabled = false;
+  return true;
+}
+
+void mgos_usleep(uint32_t usecs)
+{
+  now += usecs;
+}
+
+int64_t mgos_uptime_micros(void)
+{
+  return now;
+}
+
+static bool post(mgos_cb_t cb, void *arg, int64_t due)
+{
+  if (numCallbacks == MAX_CALLBACKS)
+    return false;
+  int k = numCallbacks++;
+  for (; k > 0 && callbacks[k - 1].due > due; k--)
+    callbacks[k] = callbacks[k - 1];
+  callbacks[k] = (Callback){cb, arg, due};
+  return true;
+}
+
+bool mgos_invoke_cb(mgos_cb_t cb, void *arg, bool from_isr)
+{
+  (void)from_isr;
+  return post(cb, arg, now + cfg.taskLatency);
+}
+
+mgos_timer_id mgos_set_timer(int msecs, int flags, timer_callback cb, void *cb_arg)
+{
+  (void)flags;
+  return post(cb, cb_arg, now + msecs * 1000);
+}
+
+static double uniform(void)
+{
+  return rand() / (RAND_MAX + 1.0);
+}
+
+static int compareOn(const void *a, const void *b)
+{
+  const Interval *x = a, *y = b;
+  return (x->on > y->on) - (x->on < y->on);
+}
+
+static int compareTime(const void *a, const void *b)
+{
+  const int64_t *x = a, *y = b;
+  return (*x > *y) - (*x < *y);
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+  const double *x = a, *y = b;
+  return (*x > *y) - (*x < *y);
+}
+
+/* bookkeeping of one receiver run */
+typedef struct Receiver
+{
+  const Transmitter *tx;
+  const Burst *bursts;
+  int numBursts;
+  char *credited;
+  double *latencies;
+  RxStats st;
+} Receiver;
+
+/*
+ * Matches the code the library reported, if any, to the burst that sent it.
+ */
+static void collect(Receiver *r)
+{
+  if (!available())
+    return;
+
+  const unsigned long value = getReceivedValue();
+  int match = -1;
+  for (int b = 0; b < r->numBursts; b++)
+  {
+    if (r->bursts[b].start > now)
+      break;
+    if (r->tx[r->bursts[b].tx].code == value)
+      match = b;
+  }
+  if (match < 0)
+  {
+    r->st.falseCodes++;
+  }
+  else if (getReceivedProtocol() != (unsigned int)r->tx[r->bursts[match].tx].protocol)
+  {
+    r->st.wrongProtocol++;
+  }
+  else if (!r->credited[match])
+  {
+    r->credited[match] = 1;
+    r->latencies[r->st.decoded++] = (now - r->bursts[match].start) / 1000.0;
+  }
+  resetAvailable();
+}
+
+/*
+ * Runs the callbacks that are due up to time until, as the main task.
+ */
+static void runTask(Receiver *r, int64_t until)
+{
+  while (numCallbacks > 0 && callbacks[0].due <= until)
+  {
+    const Callback c = callbacks[0];
+    memmove(callbacks, callbacks + 1, --numCallbacks * sizeof(*callbacks));
+    now = c.due;
+    c.cb(c.arg);
+    r->st.taskCalls++;
+    collect(r);
+  }
+}
+
+static void addEdge(int64_t t)
+{
+  edges = grow(edges, &capEdges, numEdges, sizeof(*edges));
+  edges[numEdges++] = t;
+}
+
+/*
+ * Builds the sorted list of level changes one receiver sees. drop[t] is the
+ * pulse drop probability of the link from transmitter t. Carriers and idle
+ * noise are OR-ed together; every spike flips the level for its width, so it
+ * cuts a pulse where it lands on one.
+ */
+static void receiveEdges(const double *drop)
+{
+  Interval *rx = malloc((numIntervals + 1) * sizeof(*rx));
+  size_t n = 0;
+  const int64_t end = cfg.seconds * 1e6;
+
+  for (size_t i = 0; i < numIntervals; i++)
+  {
+    if (uniform() >= drop[intervals[i].tx])
+      rx[n++] = intervals[i];
+  }
+  qsort(rx, n, sizeof(*rx), compareOn);
+
+  /* the union of all carriers, with idle noise ahead of each stretch of it
+   * and after the last one */
+  numEdges = 0;
+  int64_t idle = -(int64_t)cfg.agcDelay;
+  size_t i = 0;
+  for (;;)
+  {
+    int64_t on = (i < n) ? rx[i].on : end;
+    int64_t off = on;
+    for (; i < n && rx[i].on <= off; i++)
+    {
+      if (rx[i].off > off)
+        off = rx[i].off;
+    }
+    for (int64_t t = idle + cfg.agcDelay; cfg.idleNoise && t < on;)
+    {
+      const int64_t high = 1 + rand() % (2 * cfg.idleNoise);
+      addEdge(t);
+      addEdge(t + high < on ? t + high : on);
+      t += high + 1 + rand() % (2 * cfg.idleNoise);
+    }
+    if (on >= end)
+      break;
+    addEdge(on);
+    addEdge(off);
+    idle = off;
+  }
+
+  const size_t numSpikes = cfg.spikesPerSecond * cfg.seconds;
+  for (size_t k = 0; k < numSpikes; k++)
+  {
+    const int64_t t = uniform() * end;
+    addEdge(t);
+    addEdge(t + cfg.spikeMin + rand() % (cfg.spikeMax - cfg.spikeMin + 1));
+  }
+
+  /* two level changes at the same time cancel out */
+  qsort(edges, numEdges, sizeof(*edges), compareTime);
+  size_t m = 0;
+  for (size_t k = 0; k < numEdges; k++)
+  {
+    if (m > 0 && edges[m - 1] == edges[k])
+      m--;
+    else
+      edges[m++] = edges[k];
+  }
+  numEdges = m;
+  free(rx);
+}
+
+/*
+ * Runs one receiver over the whole timeline. Returns its statistics, with
+ * the latencies of its decodes in *latencies. Called in a child process.
+ */
+static RxStats runReceiver(const Transmitter *tx, const Burst *bursts, int numBursts,
+                           const double *drop, double **latencies)
+{
+  Receiver r = {tx, bursts, numBursts, calloc(numBursts, 1),
+                malloc((numBursts + 1) * sizeof(double)), {0, 0, 0, 0, 0}};
+
+  receiveEdges(drop);
+  setGlitchFilter(cfg.glitch);
+  setNoiseGate(cfg.gateEdges, cfg.gateWindow);
+
+  for (size_t i = 0; i < numEdges; i++)
+  {
+    runTask(&r, edges[i]);
+    if (!rxEnabled)
+      continue;
+    now = edges[i];
+    handleInterrupt_cb(2, NULL);
+    r.st.isrCalls++;
+  }
+  runTask(&r, INT64_MAX);
+
+  free(r.credited);
+  *latencies = r.latencies;
+  return r.st;
+}
+
+/*
+ * Reads exactly size bytes from fd.
+ */
+static bool readAll(int fd, void *buf, size_t size)
+{
+  char *p = buf;
+  while (size > 0)
+  {
+    const ssize_t got = read(fd, p, size);
+    if (got <= 0)
+      return false;
+    p += got;
+    size -= got;
+  }
+  return true;
+}
+
+/*
+ * Simulates numTx transmitters and prints one line of results.
+ */
+static void runScenario(int numTx)
+{
+  Transmitter *tx = calloc(numTx, sizeof(*tx));
+  /* drop probability per link, drop[r * numTx + t] */
+  double *drop = malloc(cfg.receivers * numTx * sizeof(*drop));
+  Burst *bursts = NULL;
+  size_t numBursts = 0, capBursts = 0;
+  const int64_t end = cfg.seconds * 1e6;
+
+  srand(cfg.seed + numTx);
+  numIntervals = 0;
+
+  for (int t = 0; t < numTx; t++)
+  {
+    tx[t].protocol = cfg.protocols[t % cfg.numProtocols];
+    tx[t].length = (tx[t].protocol == 13) ? 32 : 24;
+    do
+    {
+      tx[t].code = ((unsigned long)rand() << 8 ^ rand()) & ((1UL << (tx[t].length - 1)) * 2 - 1);
+      for (int u = 0; u < t; u++)
+      {
+        if (tx[u].code == tx[t].code)
+          tx[t].code = 0;
+      }
+    } while (tx[t].code == 0);
+  }
+  for (int k = 0; k < cfg.receivers * numTx; k++)
+    drop[k] = uniform() * cfg.maxDrop;
+
+  /* let every transmitter send its bursts on the virtual clock */
+  for (int t = 0; t < numTx; t++)
+  {
+    const double period = cfg.intervalMs * 1000 * (0.8 + 0.4 * uniform());
+    int64_t start = uniform() * period;
+
+    setProtocol1(tx[t].protocol);
+    setPulseLength(protocol.pulseLength * (1 + cfg.skew * (2 * uniform() - 1)));
+    setRepeatTransmit(cfg.repeats);
+    txCurrent = t;
+    while (start < end)
+    {
+      now = start;
+      send1(tx[t].code, tx[t].length);
+      bursts = grow(bursts, &capBursts, numBursts, sizeof(*bursts));
+      bursts[numBursts++] = (Burst){t, start, now};
+      start += period * (0.9 + 0.2 * uniform());
+    }
+  }
+  /* receivers look bursts up by start time */
+  for (size_t a = 1; a < numBursts; a++)
+  {
+    Burst b = bursts[a];
+    size_t k = a;
+    for (; k > 0 && bursts[k - 1].start > b.start; k--)
+      bursts[k] = bursts[k - 1];
+    bursts[k] = b;
+  }
+
+  RxStats total = {0, 0, 0, 0, 0};
+  double *latencies = malloc((numBursts * cfg.receivers + 1) * sizeof(*latencies));
+  for (int r = 0; r < cfg.receivers; r++)
+  {
+    int fd[2];
+    RxStats st;
+    double *lat;
+
+    if (pipe(fd) != 0)
+    {
+      perror("pipe");
+      exit(1);
+    }
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(fd[0]);
+      srand(cfg.seed * 7919 + numTx * 31 + r);
+      st = runReceiver(tx, bursts, numBursts, drop + r * numTx, &lat);
+      const size_t size = st.decoded * sizeof(*lat);
+      if (write(fd[1], &st, sizeof(st)) != sizeof(st) || (size_t)write(fd[1], lat, size) != size)
+        _exit(1);
+      _exit(0);
+    }
+    close(fd[1]);
+    if (pid < 0 || read(fd[0], &st, sizeof(st)) != sizeof(st) ||
+        !readAll(fd[0], latencies + total.decoded, st.decoded * sizeof(*latencies)))
+    {
+      fprintf(stderr, "receiver %d failed\n", r);
+      exit(1);
+    }
+    close(fd[0]);
+    waitpid(pid, NULL, 0);
+
+    total.decoded += st.decoded;
+    total.wrongProtocol += st.wrongProtocol;
+    total.falseCodes += st.falseCodes;
+    total.isrCalls += st.isrCalls;
+    total.taskCalls += st.taskCalls;
+  }
+
+  /* latency over the decodes of all receivers */
+  double latencySum = 0, latencyP95 = 0;
+  for (unsigned int k = 0; k < total.decoded; k++)
+    latencySum += latencies[k];
+  if (total.decoded > 0)
+  {
+    qsort(latencies, total.decoded, sizeof(*latencies), compareDouble);
+    latencyP95 = latencies[(total.decoded * 95 + 99) / 100 - 1];
+  }
+
+  const double sent = (double)numBursts * cfg.receivers;
+  printf("%7d %7zu %8u %6.1f%% %10.1f %10.1f %11u %6u %10u %10u\n", numTx, numBursts, total.decoded,
+         sent > 0 ? 100.0 * total.decoded / sent : 0.0,
+         total.decoded ? latencySum / total.decoded : 0.0,
+         latencyP95, total.wrongProtocol, total.falseCodes, total.isrCalls,
+         total.taskCalls);
+
+  free(latencies);
+  free(bursts);
+  free(drop);
+  free(tx);
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -n N      simulate 1, 2, 4, ... up to N transmitters (%d)\n"
+          "  -r N      receivers per run (%d)\n"
+          "  -t SEC    simulated time per run (%.0f)\n"
+          "  -i MS     mean time between bursts of one transmitter (%.0f)\n"
+          "  -R N      frames per burst, i.e. setRepeatTransmit (%d)\n"
+          "  -k FRAC   max pulse length skew per transmitter (%.2f)\n"
+          "  -d FRAC   max pulse drop probability per link (%.2f)\n"
+          "  -S N      noise spikes per second at each receiver (%.0f)\n"
+          "  -w MIN,MAX  width of the noise spikes in us (%u,%u)\n"
+          "  -N US     idle noise: mean pulse length of the noise a receiver\n"
+          "            puts out without carrier (off)\n"
+          "  -a US     time without carrier before idle noise starts (%u)\n"
+          "  -g US     glitch filter, see setGlitchFilter (%u)\n"
+          "  -G E,US   noise gate, see setNoiseGate (off)\n"
+          "  -L US     delay before the main task runs a decode callback (%u)\n"
+          "  -p LIST   protocols to use, e.g. 1,2,11\n"
+          "  -s SEED   random seed (%u)\n",
+          argv0, cfg.maxDevices, cfg.receivers, cfg.seconds, cfg.intervalMs,
+          cfg.repeats, cfg.skew, cfg.maxDrop, cfg.spikesPerSecond, cfg.spikeMin, cfg.spikeMax,
+          cfg.agcDelay, cfg.glitch, cfg.taskLatency,
+          cfg.seed);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:r:t:i:R:k:d:S:w:N:a:g:G:L:p:s:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      cfg.maxDevices = atoi(optarg);
+      break;
+    case 'r':
+      cfg.receivers = atoi(optarg);
+      break;
+    case 't':
+      cfg.seconds = atof(optarg);
+      break;
+    case 'i':
+      cfg.intervalMs = atof(optarg);
+      break;
+    case 'R':
+      cfg.repeats = atoi(optarg);
+      break;
+    case 'k':
+      cfg.skew = atof(optarg);
+      break;
+    case 'd':
+      cfg.maxDrop = atof(optarg);
+      break;
+    case 'S':
+      cfg.spikesPerSecond = atof(optarg);
+      break;
+    case 'w':
+      if (sscanf(optarg, "%u,%u", &cfg.spikeMin, &cfg.spikeMax) != 2 ||
+          cfg.spikeMin < 1 || cfg.spikeMax < cfg.spikeMin)
+        usage(argv[0]);
+      break;
+    case 'N':
+      cfg.idleNoise = atoi(optarg);
+      break;
+    case 'a':
+      cfg.agcDelay = atoi(optarg);
+      break;
+    case 'g':
+      cfg.glitch = atoi(optarg);
+      break;
+    case 'G':
+      if (sscanf(optarg, "%u,%u", &cfg.gateEdges, &cfg.gateWindow) != 2)
+        usage(argv[0]);
+      break;
+    case 'L':
+      cfg.taskLatency = atoi(optarg);
+      break;
+    case 'p':
+      cfg.numProtocols = 0;
+      for (char *p = strtok(optarg, ","); p && cfg.numProtocols < MAX_PROTOCOLS; p = strtok(NULL, ","))
+      {
+        const int n = atoi(p);
+        /* RCSwitch.c asserts that the mask only selects rows of its table */
+        if (n < 1 || n > 32 || !((RCSWITCH_PROTOCOLS >> (n - 1)) & 1))
+        {
+          fprintf(stderr, "%s: protocol %s is not in RCSWITCH_PROTOCOLS (%#x)\n",
+                  argv[0], p, (unsigned int)RCSWITCH_PROTOCOLS);
+          exit(2);
+        }
+        cfg.protocols[cfg.numProtocols++] = n;
+      }
+      break;
+    case 's':
+      cfg.seed = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (cfg.maxDevices < 1 || cfg.receivers < 1 || cfg.numProtocols < 1)
+    usage(argv[0]);
+
+  RCSwitch_Init();
+  enableTransmit(1);
+  enableReceive(2);
+
+  printf("devices  bursts  decoded  yield  lat_avg_ms lat_p95_ms wrong_proto  false  isr_calls task_calls\n");
+  for (int n = 1;; n *= 2)
+  {
+    if (n > cfg.maxDevices)
+      n = cfg.maxDevices;
+    runScenario(n);
+    if (n == cfg.maxDevices)
+      break;
+  }
+  return 0;
+}